@@ -8,6 +8,7 @@ Almost trivial AST for bf compiler.
 #define AST_H
 
 #include <cstdint>
+#include <map>
 #include <vector>
 #include <memory>
 #include <string>
@@ -24,6 +25,9 @@ namespace bfllvm
     class Value_Increment;
     class Put_Char;
     class Get_Char;
+    class Cell_Block_Update;
+    class Multiply_Add_Loop;
+    class Counted_Loop;
 
     class AST_Visitor
     {
@@ -36,14 +40,36 @@ namespace bfllvm
         virtual void visit(const Value_Increment &v) {}
         virtual void visit(const Put_Char &v) {}
         virtual void visit(const Get_Char &v) {}
+        virtual void visit(const Cell_Block_Update &v) {}
+        virtual void visit(const Multiply_Add_Loop &v) {}
+        virtual void visit(const Counted_Loop &v) {}
+    };
+
+    // Position of a command in the bf source, 1-based; 0 means unknown.
+    struct Source_Location
+    {
+        std::uint32_t line{0};
+        std::uint32_t column{0};
     };
 
     class AST_Element
     {
+        Source_Location _location;
 
     public:
         virtual std::string print(std::uint32_t indentation = 0) const = 0;
 
+        // position of the (first) command this element was created from
+        const Source_Location &get_location() const
+        {
+            return _location;
+        }
+
+        void set_location(const Source_Location &location)
+        {
+            _location = location;
+        }
+
         virtual ~AST_Element() = default;
 
         virtual void accept(AST_Visitor &visitor) = 0;
@@ -216,6 +242,121 @@ namespace bfllvm
         };
     };
 
+    // Balanced loop whose control cell is only changed by a constant odd
+    // amount per iteration, hence runs exactly n = (*ptr * trip_scale) mod 256
+    // times. Executed as for (i = 0; i < n; ++i) { body }; *ptr = 0;
+    // The body only contains the updates of the control cell if it reads it.
+    class Counted_Loop : public Sequence
+    {
+        std::uint8_t _trip_scale;
+
+    public:
+        Counted_Loop(const Sequence &seq, std::uint8_t trip_scale)
+            : Sequence(), _trip_scale{trip_scale}
+        {
+            _inner = seq.get_inner();
+        }
+
+        std::uint8_t get_trip_scale() const
+        {
+            return _trip_scale;
+        }
+
+        std::string print(std::uint32_t indentation) const override
+        {
+            std::string indent(indentation, ' ');
+            return indent + "for(i<*ptr*" + std::to_string(_trip_scale) + ")" +
+                   Sequence::print(indentation);
+        }
+
+        void accept(AST_Visitor &visitor) override
+        {
+            visitor.visit(*this);
+        };
+    };
+
+    // Update of a cell relative to the current pointer position:
+    // new value = (clear ? 0 : old value) + delta (mod 256).
+    struct Cell_Update
+    {
+        bool clear{false};
+        std::uint8_t delta{0};
+    };
+
+    // Folded straight-line run of <, >, +, - and [-] (clear) commands:
+    // all touched cells are updated at once (offsets relative to the pointer
+    // before the run), then the pointer is moved by pointer_move.
+    class Cell_Block_Update : public Instruction
+    {
+        std::map<std::int32_t, Cell_Update> _cells;
+        std::int32_t _pointer_move;
+
+        std::string get_type() const override
+        {
+            std::string result = "block";
+            for (const auto &[offset, update] : _cells)
+            {
+                result += " [" + std::to_string(offset) + "]" +
+                          (update.clear ? "=" : "+=") +
+                          std::to_string(update.delta);
+            }
+            return result + " ptr+=" + std::to_string(_pointer_move);
+        }
+
+    public:
+        Cell_Block_Update(const std::map<std::int32_t, Cell_Update> &cells,
+                          std::int32_t pointer_move)
+            : _cells{cells}, _pointer_move{pointer_move} {}
+
+        const std::map<std::int32_t, Cell_Update> &get_cells() const
+        {
+            return _cells;
+        }
+
+        std::int32_t get_pointer_move() const
+        {
+            return _pointer_move;
+        }
+
+        void accept(AST_Visitor &visitor) override
+        {
+            visitor.visit(*this);
+        };
+    };
+
+    // Balanced loop without I/O whose only effect is adding a multiple
+    // of the control cell to other cells, e.g. [->+>++<<]:
+    // if (*ptr != 0) { ptr[k] += *ptr * factor[k] for all k; *ptr = 0; }
+    class Multiply_Add_Loop : public Instruction
+    {
+        std::map<std::int32_t, std::uint8_t> _factors;
+
+        std::string get_type() const override
+        {
+            std::string result = "muladd";
+            for (const auto &[offset, factor] : _factors)
+            {
+                result += " [" + std::to_string(offset) + "]+=*ptr*" +
+                          std::to_string(factor);
+            }
+            return result;
+        }
+
+    public:
+        Multiply_Add_Loop(const std::map<std::int32_t, std::uint8_t> &factors)
+            : _factors{factors} {}
+
+        const std::map<std::int32_t, std::uint8_t> &get_factors() const
+        {
+            return _factors;
+        }
+
+        void accept(AST_Visitor &visitor) override
+        {
+            visitor.visit(*this);
+        };
+    };
+
 }
 
 #endif
\ No newline at end of file
@@ -7,9 +7,13 @@ LLVM Code generation for bf compiler.
 #include "code_gen.h"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalVariable.h"
@@ -22,25 +26,83 @@ LLVM Code generation for bf compiler.
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/TargetParser/Host.h"
 #include <iostream>
+#include <mutex>
 
 using namespace llvm;
 
-const uint32_t BF_ARRAY_SIZE = 60000;
+// touched cells of a block update at most this far apart are handled in one
+// segment; untouched cells in between are loaded and stored back unchanged
+const int32_t MAX_CELL_GAP = 3;
+
+// segments with at least this many cells are updated with vector code; narrower
+// vectors than a 16 byte SSE register are no cheaper than scalar updates
+const int32_t MIN_VECTOR_CELLS = 16;
 
 namespace bfllvm {
+
+namespace {
+// features (e.g. "avx2") of the host CPU
+StringMap<bool> host_cpu_features() {
+#if LLVM_VERSION_MAJOR >= 19
+  return sys::getHostCPUFeatures();
+#else
+  StringMap<bool> features;
+  sys::getHostCPUFeatures(features);
+  return features;
+#endif
+}
+
+// Split the sorted offsets of cells into segments of cells lying close
+// together. Each segment is covered by vector operations as wide as possible
+// (at most max_width lanes), remaining cells are handled one by one.
+template <typename T, typename Vector_Op, typename Scalar_Op>
+void for_each_segment(const std::map<int32_t, T> &cells, unsigned max_width,
+                      Vector_Op vector_op, Scalar_Op scalar_op) {
+  auto it = cells.begin();
+  while (it != cells.end()) {
+    auto last = it;
+    auto next = std::next(it);
+    while (next != cells.end() && next->first - last->first <= MAX_CELL_GAP) {
+      last = next++;
+    }
+    int32_t offset = it->first;
+    const int32_t end = last->first + 1;
+    while (end - offset >= MIN_VECTOR_CELLS) {
+      unsigned width = max_width;
+      while (width > static_cast<unsigned>(end - offset)) {
+        width /= 2;
+      }
+      vector_op(offset, width);
+      offset += width;
+    }
+    for (auto cell = cells.lower_bound(offset); cell != next; ++cell) {
+      scalar_op(cell->first, cell->second);
+    }
+    it = next;
+  }
+}
+} // namespace
+
 void Code_Gen_Visitor::init_structures() {
-  InitializeNativeTarget();
-  InitializeNativeTargetAsmPrinter();
-  _context = new LLVMContext();
-  _module = new Module("bfllvm", *_context);
-  _builder = new IRBuilder<>(*_context);
+  // target registration is not thread-safe, do it only once
+  static std::once_flag native_target_initialized;
+  std::call_once(native_target_initialized, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+  });
+  _context = std::make_unique<LLVMContext>();
+  _module = std::make_unique<Module>("bfllvm", *_context);
+  _builder = std::make_unique<IRBuilder<>>(*_context);
   _i32_type = Type::getInt32Ty(*_context);
   _char_type = Type::getInt8Ty(*_context);
   _ptr_type = _builder->getPtrTy();
@@ -50,17 +112,44 @@ void Code_Gen_Visitor::init_structures() {
   _char_zero = ConstantInt::get(_char_type, 0);
   _char_one = ConstantInt::get(_char_type, 1);
 
+  // pick the vector width for block updates from the host's features
+  const StringMap<bool> features = host_cpu_features();
+  if (features.lookup("avx512bw")) {
+    _vector_width = 64;
+  } else if (features.lookup("avx2")) {
+    _vector_width = 32;
+  } else {
+    _vector_width = 16;
+  }
+
+  if (_target == Code_Gen_Target::EMBEDDED) {
+    // host I/O functions and int bf_run(char *tape, void *io)
+    FunctionType *put_char_type =
+        FunctionType::get(_i32_type, {_ptr_type, _i32_type}, false);
+    FunctionType *get_char_type =
+        FunctionType::get(_i32_type, {_ptr_type}, false);
+    _putchar = Function::Create(put_char_type, Function::ExternalLinkage,
+                                "bfllvm_put_char", _module.get());
+    _getchar = Function::Create(get_char_type, Function::ExternalLinkage,
+                                "bfllvm_get_char", _module.get());
+    FunctionType *run_type =
+        FunctionType::get(_i32_type, {_ptr_type, _ptr_type}, false);
+    _main = Function::Create(run_type, Function::ExternalLinkage,
+                             BF_RUN_FUNCTION_NAME, *_module);
+    return;
+  }
+
   // create required libc function declarations
   FunctionType *putchar_type = FunctionType::get(_i32_type, {_i32_type}, false);
   FunctionType *getchar_type = FunctionType::get(_i32_type, {}, false);
   FunctionType *fflush_type = FunctionType::get(_i32_type, {_ptr_type}, false);
 
   _putchar = Function::Create(putchar_type, Function::ExternalLinkage,
-                              "putchar", _module);
+                              "putchar", _module.get());
   _getchar = Function::Create(getchar_type, Function::ExternalLinkage,
-                              "getchar", _module);
+                              "getchar", _module.get());
   _fflush = Function::Create(fflush_type, Function::ExternalLinkage, "fflush",
-                             _module);
+                             _module.get());
 
   // stdout global variable declaration
   _stdout = new GlobalVariable(*_module, _ptr_type, false,
@@ -80,26 +169,86 @@ void Code_Gen_Visitor::init_structures() {
                          GlobalValue::PrivateLinkage, zero_init, "bf_array");
 }
 
+void Code_Gen_Visitor::init_debug_info() {
+  _module->addModuleFlag(Module::Warning, "Debug Info Version",
+                         DEBUG_METADATA_VERSION);
+  _module->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+  _di_builder = std::make_unique<DIBuilder>(*_module);
+
+  SmallString<128> path{_source_file};
+  // names like <stdin> are placeholders, not paths relative to the cwd
+  if (sys::fs::exists(path)) {
+    sys::fs::make_absolute(path);
+  }
+  DIFile *file = _di_builder->createFile(sys::path::filename(path),
+                                         sys::path::parent_path(path));
+  // there is no DWARF language code for bf, C comes closest
+  _di_builder->createCompileUnit(dwarf::DW_LANG_C, file, "bfllvm", false, "",
+                                 0);
+  DISubroutineType *function_type =
+      _di_builder->createSubroutineType(_di_builder->getOrCreateTypeArray({}));
+  _di_function = _di_builder->createFunction(
+      file, _main->getName(), StringRef(), file, 1, function_type, 1,
+      DINode::FlagZero, DISubprogram::SPFlagDefinition);
+  _main->setSubprogram(_di_function);
+}
+
+void Code_Gen_Visitor::set_debug_info(const std::string &source_file) {
+  _source_file = source_file;
+}
+
+void Code_Gen_Visitor::set_location(const AST_Element &v) {
+  if (_di_function == nullptr) {
+    return;
+  }
+  const auto &location = v.get_location();
+  _builder->SetCurrentDebugLocation(DILocation::get(
+      *_context, location.line, location.column, _di_function));
+}
+
 void Code_Gen_Visitor::generate_code() {
+  begin_code();
+  generate_region(_ast);
+  finish_code();
+}
+
+void Code_Gen_Visitor::begin_code() {
   init_structures();
+  if (!_source_file.empty()) {
+    init_debug_info();
+  }
 
   // allocate current_ptr, store &bf_array[0]
   BasicBlock *entry_bb = BasicBlock::Create(*_context, "entry", _main);
   _builder->SetInsertPoint(entry_bb);
   _current_ptr = _builder->CreateAlloca(_ptr_type, nullptr, "current_ptr");
-  const auto array_ref = ArrayRef<Value *>{_i32_zero};
-  _builder->CreateStore(_builder->CreateGEP(_array_type, _bf_array, array_ref),
-                        _current_ptr);
+  if (_target == Code_Gen_Target::EMBEDDED) {
+    // the tape is passed as first argument
+    _builder->CreateStore(_main->getArg(0), _current_ptr);
+    _io_state = _main->getArg(1);
+  } else {
+    const auto array_ref = ArrayRef<Value *>{_i32_zero};
+    _builder->CreateStore(
+        _builder->CreateGEP(_array_type, _bf_array, array_ref), _current_ptr);
+  }
+}
 
+void Code_Gen_Visitor::generate_region(const AST &region) {
   // generate bf code
-  _ast->accept(*this);
+  region->accept(*this);
+}
 
+void Code_Gen_Visitor::finish_code() {
   // add an end block, always return 0 here.
   BasicBlock *end_bb = BasicBlock::Create(*_context, "end", _main);
   _builder->CreateBr(end_bb);
   _builder->SetInsertPoint(end_bb);
   _builder->CreateRet(_i32_zero);
 
+  if (_di_builder != nullptr) {
+    _di_builder->finalize();
+  }
+
   // perform verification checks
   verifyFunction(*_main, &errs());
   verifyModule(*_module, &errs());
@@ -113,18 +262,32 @@ void Code_Gen_Visitor::output_current_value() {
   Value *out_value = _builder->CreateLoad(_char_type, ptr_value);
   // extend to int
   out_value = _builder->CreateSExt(out_value, _i32_type);
-  _builder->CreateCall(_putchar, out_value);
-  Value *stdout_value = _builder->CreateLoad(_ptr_type, _stdout);
-  _builder->CreateCall(_fflush, {stdout_value});
+  emit_put_char(out_value);
 }
 
 void Code_Gen_Visitor::output_char(char c) {
-  _builder->CreateCall(_putchar, ConstantInt::get(_i32_type, c));
+  emit_put_char(ConstantInt::get(_i32_type, c));
+}
+
+void Code_Gen_Visitor::emit_put_char(Value *value) {
+  if (_target == Code_Gen_Target::EMBEDDED) {
+    _builder->CreateCall(_putchar, {_io_state, value});
+    return;
+  }
+  _builder->CreateCall(_putchar, value);
   Value *stdout_value = _builder->CreateLoad(_ptr_type, _stdout);
   _builder->CreateCall(_fflush, {stdout_value});
 }
 
+Value *Code_Gen_Visitor::emit_get_char() {
+  if (_target == Code_Gen_Target::EMBEDDED) {
+    return _builder->CreateCall(_getchar, {_io_state});
+  }
+  return _builder->CreateCall(_getchar);
+}
+
 void Code_Gen_Visitor::visit(const Pointer_Increment &v) {
+  set_location(v);
   // increment (*_current_ptr)
   Value *ptr = _builder->CreateLoad(_ptr_type, _current_ptr);
   Value *inc_ptr = _builder->CreateGEP(_char_type, ptr, _i32_one);
@@ -132,6 +295,7 @@ void Code_Gen_Visitor::visit(const Pointer_Increment &v) {
 }
 
 void Code_Gen_Visitor::visit(const Pointer_Decrement &v) {
+  set_location(v);
   // decrement (*_current_ptr)
   Value *ptr = _builder->CreateLoad(_ptr_type, _current_ptr);
   Value *dec_ptr = _builder->CreateGEP(_char_type, ptr, _i32_minus_one);
@@ -139,6 +303,7 @@ void Code_Gen_Visitor::visit(const Pointer_Decrement &v) {
 }
 
 void Code_Gen_Visitor::visit(const Value_Increment &v) {
+  set_location(v);
   // increment *(*_current_ptr)
   Value *ptr = _builder->CreateLoad(_ptr_type, _current_ptr);
   Value *old_value = _builder->CreateLoad(_char_type, ptr);
@@ -147,6 +312,7 @@ void Code_Gen_Visitor::visit(const Value_Increment &v) {
 }
 
 void Code_Gen_Visitor::visit(const Value_Decrement &v) {
+  set_location(v);
   // decrement *(*_current_ptr)
   Value *ptr = _builder->CreateLoad(_ptr_type, _current_ptr);
   Value *old_value = _builder->CreateLoad(_char_type, ptr);
@@ -154,11 +320,15 @@ void Code_Gen_Visitor::visit(const Value_Decrement &v) {
   _builder->CreateStore(new_value, ptr);
 }
 
-void Code_Gen_Visitor::visit(const Put_Char &v) { output_current_value(); }
+void Code_Gen_Visitor::visit(const Put_Char &v) {
+  set_location(v);
+  output_current_value();
+}
 
 void Code_Gen_Visitor::visit(const Get_Char &v) {
+  set_location(v);
   // call getchar() and store the return value in *(*_current_ptr)
-  Value *in_value = _builder->CreateCall(_getchar);
+  Value *in_value = emit_get_char();
   in_value = _builder->CreateTrunc(in_value, _char_type);
   Value *ptr_value = _builder->CreateLoad(_ptr_type, _current_ptr);
   _builder->CreateStore(in_value, ptr_value);
@@ -172,6 +342,7 @@ void Code_Gen_Visitor::visit(const Sequence &v) {
 }
 
 void Code_Gen_Visitor::visit(const While_Loop &v) {
+  set_location(v);
   // create a block computing the condition *(*_current_ptr) != 0
   BasicBlock *cond_bb = BasicBlock::Create(*_context, "condition", _main);
   _builder->CreateBr(cond_bb);
@@ -197,6 +368,7 @@ void Code_Gen_Visitor::visit(const While_Loop &v) {
   }
 
   // create another block for jumping back to the condition
+  set_location(v);
   BasicBlock *loop_jump_back_bb =
       BasicBlock::Create(*_context, "loop_back", _main);
   _builder->CreateBr(loop_jump_back_bb);
@@ -207,6 +379,213 @@ void Code_Gen_Visitor::visit(const While_Loop &v) {
   _builder->SetInsertPoint(after_loop_bb);
 }
 
+Value *Code_Gen_Visitor::cell_address(Value *ptr, int32_t offset) {
+  if (offset == 0) {
+    return ptr;
+  }
+  return _builder->CreateGEP(_char_type, ptr,
+                             ConstantInt::get(_i32_type, offset, true));
+}
+
+void Code_Gen_Visitor::emit_cell_update(Value *ptr, int32_t offset,
+                                        const Cell_Update &update) {
+  Value *address = cell_address(ptr, offset);
+  Value *delta = ConstantInt::get(_char_type, update.delta);
+  if (update.clear) {
+    _builder->CreateStore(delta, address);
+    return;
+  }
+  Value *old_value = _builder->CreateLoad(_char_type, address);
+  _builder->CreateStore(_builder->CreateAdd(old_value, delta), address);
+}
+
+void Code_Gen_Visitor::emit_vector_update(
+    Value *ptr, int32_t offset, unsigned width,
+    const std::map<int32_t, Cell_Update> &cells) {
+  // new lane value = (old lane value & mask) + delta, where mask is 0 for
+  // cleared cells and 0xff otherwise
+  std::vector<Constant *> masks;
+  std::vector<Constant *> deltas;
+  bool any_clear = false;
+  bool all_clear = true;
+  for (unsigned lane = 0; lane < width; ++lane) {
+    const auto cell = cells.find(offset + static_cast<int32_t>(lane));
+    const Cell_Update update =
+        cell != cells.end() ? cell->second : Cell_Update{};
+    masks.push_back(ConstantInt::get(_char_type, update.clear ? 0 : 0xff));
+    deltas.push_back(ConstantInt::get(_char_type, update.delta));
+    any_clear |= update.clear;
+    all_clear &= update.clear;
+  }
+  auto *vector_type = FixedVectorType::get(_char_type, width);
+  Value *address = cell_address(ptr, offset);
+  Value *new_value = ConstantVector::get(deltas);
+  if (!all_clear) {
+    Value *old_value =
+        _builder->CreateAlignedLoad(vector_type, address, MaybeAlign(1));
+    if (any_clear) {
+      old_value = _builder->CreateAnd(old_value, ConstantVector::get(masks));
+    }
+    new_value = _builder->CreateAdd(old_value, new_value);
+  }
+  _builder->CreateAlignedStore(new_value, address, MaybeAlign(1));
+}
+
+void Code_Gen_Visitor::emit_vector_multiply_add(
+    Value *ptr, Value *value, int32_t offset, unsigned width,
+    const std::map<int32_t, std::uint8_t> &factors) {
+  std::vector<Constant *> lane_factors;
+  for (unsigned lane = 0; lane < width; ++lane) {
+    const auto factor = factors.find(offset + static_cast<int32_t>(lane));
+    lane_factors.push_back(ConstantInt::get(
+        _char_type, factor != factors.end() ? factor->second : 0));
+  }
+  auto *vector_type = FixedVectorType::get(_char_type, width);
+  Value *address = cell_address(ptr, offset);
+  Value *old_value =
+      _builder->CreateAlignedLoad(vector_type, address, MaybeAlign(1));
+  Value *product =
+      _builder->CreateMul(_builder->CreateVectorSplat(width, value),
+                          ConstantVector::get(lane_factors));
+  _builder->CreateAlignedStore(_builder->CreateAdd(old_value, product), address,
+                               MaybeAlign(1));
+}
+
+void Code_Gen_Visitor::visit(const Cell_Block_Update &v) {
+  set_location(v);
+  Value *ptr = _builder->CreateLoad(_ptr_type, _current_ptr);
+  const auto &cells = v.get_cells();
+  for_each_segment(
+      cells, _vector_width,
+      [&](int32_t offset, unsigned width) {
+        emit_vector_update(ptr, offset, width, cells);
+      },
+      [&](int32_t offset, const Cell_Update &update) {
+        emit_cell_update(ptr, offset, update);
+      });
+  if (v.get_pointer_move() != 0) {
+    _builder->CreateStore(cell_address(ptr, v.get_pointer_move()),
+                          _current_ptr);
+  }
+}
+
+void Code_Gen_Visitor::visit(const Multiply_Add_Loop &v) {
+  set_location(v);
+  // if (*ptr != 0) { ptr[k] += *ptr * factor[k]; *ptr = 0; }
+  // the check keeps cells untouched that the loop would never reach
+  Value *ptr = _builder->CreateLoad(_ptr_type, _current_ptr);
+  Value *value = _builder->CreateLoad(_char_type, ptr);
+  BasicBlock *mul_add_bb = BasicBlock::Create(*_context, "mul_add", _main);
+  BasicBlock *after_mul_add_bb =
+      BasicBlock::Create(*_context, "after_mul_add", _main);
+  Value *comparison = _builder->CreateICmpNE(value, _char_zero, "cmp");
+  _builder->CreateCondBr(comparison, mul_add_bb, after_mul_add_bb);
+
+  _builder->SetInsertPoint(mul_add_bb);
+  for_each_segment(
+      v.get_factors(), _vector_width,
+      [&](int32_t offset, unsigned width) {
+        emit_vector_multiply_add(ptr, value, offset, width, v.get_factors());
+      },
+      [&](int32_t offset, std::uint8_t factor) {
+        Value *address = cell_address(ptr, offset);
+        Value *old_value = _builder->CreateLoad(_char_type, address);
+        Value *product =
+            _builder->CreateMul(value, ConstantInt::get(_char_type, factor));
+        _builder->CreateStore(_builder->CreateAdd(old_value, product), address);
+      });
+  _builder->CreateStore(_char_zero, ptr);
+  _builder->CreateBr(after_mul_add_bb);
+
+  _builder->SetInsertPoint(after_mul_add_bb);
+}
+
+void Code_Gen_Visitor::visit(const Counted_Loop &v) {
+  set_location(v);
+  // n = (*ptr * trip_scale) mod 256;
+  // if (n != 0) { i = 0; do { body; ++i; } while (i < n); }  *ptr = 0;
+  Value *ptr = _builder->CreateLoad(_ptr_type, _current_ptr);
+  Value *control = _builder->CreateLoad(_char_type, ptr);
+  Value *trip_count = _builder->CreateZExt(
+      _builder->CreateMul(control,
+                          ConstantInt::get(_char_type, v.get_trip_scale())),
+      _i32_type, "trip_count");
+  BasicBlock *preheader_bb = _builder->GetInsertBlock();
+  BasicBlock *loop_body_start_bb =
+      BasicBlock::Create(*_context, "counted_body_start", _main);
+  BasicBlock *after_loop_bb =
+      BasicBlock::Create(*_context, "after_counted_loop", _main);
+  Value *not_empty = _builder->CreateICmpNE(trip_count, _i32_zero, "cmp");
+  _builder->CreateCondBr(not_empty, loop_body_start_bb, after_loop_bb);
+
+  // code for loop body
+  _builder->SetInsertPoint(loop_body_start_bb);
+  PHINode *counter = _builder->CreatePHI(_i32_type, 2, "counter");
+  counter->addIncoming(_i32_zero, preheader_bb);
+  uint32_t length = v.size();
+  for (uint32_t i = 0; i < length; ++i) {
+    v.get(i)->accept(*this);
+  }
+
+  // increment counter and jump back while it is below the trip count
+  set_location(v);
+  BasicBlock *latch_bb = BasicBlock::Create(*_context, "counted_latch", _main);
+  _builder->CreateBr(latch_bb);
+  _builder->SetInsertPoint(latch_bb);
+  Value *next_counter =
+      _builder->CreateAdd(counter, _i32_one, "next_counter", true, true);
+  counter->addIncoming(next_counter, latch_bb);
+  Value *again = _builder->CreateICmpULT(next_counter, trip_count, "again");
+  _builder->CreateCondBr(again, loop_body_start_bb, after_loop_bb);
+
+  // the body is balanced, so ptr still points to the control cell
+  _builder->SetInsertPoint(after_loop_bb);
+  _builder->CreateStore(_char_zero, ptr);
+}
+
+std::unique_ptr<Module> Code_Gen_Visitor::take_module() {
+  return std::move(_module);
+}
+
+std::unique_ptr<LLVMContext> Code_Gen_Visitor::take_context() {
+  return std::move(_context);
+}
+
+void Code_Gen_Visitor::optimize_module() {
+  const std::string triple = sys::getProcessTriple();
+  std::string error;
+  const Target *target = TargetRegistry::lookupTarget(triple, error);
+  if (target == nullptr) {
+    errs() << "Cannot optimize for " << triple << ": " << error << "\n";
+    return;
+  }
+  std::string features;
+  for (const auto &feature : host_cpu_features()) {
+    features += (features.empty() ? "" : ",") +
+                std::string(feature.getValue() ? "+" : "-") +
+                feature.getKey().str();
+  }
+  std::unique_ptr<TargetMachine> target_machine{target->createTargetMachine(
+      triple, sys::getHostCPUName(), features, TargetOptions(), Reloc::PIC_)};
+  _module->setTargetTriple(triple);
+  _module->setDataLayout(target_machine->createDataLayout());
+
+  LoopAnalysisManager loop_analyses;
+  FunctionAnalysisManager function_analyses;
+  CGSCCAnalysisManager cgscc_analyses;
+  ModuleAnalysisManager module_analyses;
+  PassBuilder pass_builder{target_machine.get()};
+  pass_builder.registerModuleAnalyses(module_analyses);
+  pass_builder.registerCGSCCAnalyses(cgscc_analyses);
+  pass_builder.registerFunctionAnalyses(function_analyses);
+  pass_builder.registerLoopAnalyses(loop_analyses);
+  pass_builder.crossRegisterProxies(loop_analyses, function_analyses,
+                                    cgscc_analyses, module_analyses);
+  ModulePassManager passes =
+      pass_builder.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+  passes.run(*_module, module_analyses);
+}
+
 void Code_Gen_Visitor::write_object_file(std::string out_file) {
   std::error_code EC;
   raw_fd_ostream OS(out_file, EC, sys::fs::FA_Write);
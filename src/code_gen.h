@@ -8,9 +8,11 @@ LLVM Code generation for bf compiler.
 #define CODE_GEN_H
 
 #include "ast.h"
+#include "tape.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
@@ -29,13 +31,29 @@ LLVM Code generation for bf compiler.
 
 namespace bfllvm {
 
-class Code_Gen_Visitor : public AST_Visitor {
-  const AST &_ast;
+// Kind of code to generate:
+// EXECUTABLE: a main function working on a global tape, using putchar and
+// getchar of the C library.
+// EMBEDDED: a function
+//   int bf_run(char *tape, void *io)
+// working on the given tape, calling the host functions
+//   int bfllvm_put_char(void *io, int value)
+//   int bfllvm_get_char(void *io)
+// for I/O; used for JIT compilation.
+enum class Code_Gen_Target : std::uint32_t { EXECUTABLE = 0, EMBEDDED };
+
+// name of the generated function for Code_Gen_Target::EMBEDDED
+const char *const BF_RUN_FUNCTION_NAME = "bf_run";
 
-  // builder structures
-  llvm::LLVMContext *_context;
-  llvm::IRBuilder<> *_builder;
-  llvm::Module *_module;
+class Code_Gen_Visitor : public AST_Visitor {
+  const AST _ast;
+  const Code_Gen_Target _target;
+
+  // builder structures; declared in reverse order of destruction, the context
+  // has to outlive everything created in it
+  std::unique_ptr<llvm::LLVMContext> _context;
+  std::unique_ptr<llvm::IRBuilder<>> _builder;
+  std::unique_ptr<llvm::Module> _module;
   llvm::Function *_main;
 
   // llvm structures
@@ -55,6 +73,15 @@ class Code_Gen_Visitor : public AST_Visitor {
   llvm::Value *_current_ptr{nullptr};
   llvm::GlobalVariable *_bf_array{nullptr};
   llvm::GlobalVariable *_stdout{nullptr};
+  // opaque I/O state passed to bf_run (Code_Gen_Target::EMBEDDED only)
+  llvm::Value *_io_state{nullptr};
+  // number of i8 lanes in the widest vector registers of the host
+  unsigned _vector_width{16};
+
+  // debug information, only emitted if _source_file is set
+  std::string _source_file;
+  std::unique_ptr<llvm::DIBuilder> _di_builder;
+  llvm::DISubprogram *_di_function{nullptr};
 
   // code generation functions
 
@@ -64,6 +91,10 @@ class Code_Gen_Visitor : public AST_Visitor {
   // can be used for debugging
   void output_char(char number);
 
+  // emit code writing the i32 value, resp. reading a character (i32)
+  void emit_put_char(llvm::Value *value);
+  llvm::Value *emit_get_char();
+
   void visit(const Pointer_Decrement &v) override;
   void visit(const Pointer_Increment &v) override;
   void visit(const Value_Decrement &v) override;
@@ -72,15 +103,66 @@ class Code_Gen_Visitor : public AST_Visitor {
   void visit(const Get_Char &v) override;
   void visit(const Sequence &v) override;
   void visit(const While_Loop &v) override;
+  void visit(const Cell_Block_Update &v) override;
+  void visit(const Multiply_Add_Loop &v) override;
+  void visit(const Counted_Loop &v) override;
+
+  // address of the cell at ptr + offset
+  llvm::Value *cell_address(llvm::Value *ptr, std::int32_t offset);
+
+  // emit code for one cell of a block update, resp. for width consecutive
+  // cells starting at ptr + offset using a single vector load and store
+  void emit_cell_update(llvm::Value *ptr, std::int32_t offset,
+                        const Cell_Update &update);
+  void emit_vector_update(llvm::Value *ptr, std::int32_t offset,
+                          unsigned width,
+                          const std::map<std::int32_t, Cell_Update> &cells);
+
+  // emit ptr[k] += value * factors[k] for width consecutive cells
+  void emit_vector_multiply_add(
+      llvm::Value *ptr, llvm::Value *value, std::int32_t offset,
+      unsigned width, const std::map<std::int32_t, std::uint8_t> &factors);
 
   void init_structures();
+  void init_debug_info();
+
+  // attach the source location of v to the code emitted next
+  void set_location(const AST_Element &v);
 
 public:
-  Code_Gen_Visitor(const AST &ast)
-      : _ast{ast}, _context{}, _builder{}, _module{}, _main{} {}
+  Code_Gen_Visitor(const AST &ast,
+                   Code_Gen_Target target = Code_Gen_Target::EXECUTABLE)
+      : _ast{ast}, _target{target}, _context{}, _builder{}, _module{},
+        _main{} {}
+
+  // Emit DWARF debug information mapping the generated code to line and
+  // column of the commands in source_file. Call before generating code.
+  void set_debug_info(const std::string &source_file);
 
+  // for streaming code generation via begin_code, generate_region and
+  // finish_code
+  Code_Gen_Visitor(Code_Gen_Target target = Code_Gen_Target::EXECUTABLE)
+      : Code_Gen_Visitor(nullptr, target) {}
+
+  // generate code for the whole AST given to the constructor
   void generate_code();
 
+  // Streaming alternative to generate_code: start the module, append code
+  // for consecutive parts of the program, then complete the module.
+  void begin_code();
+  void generate_region(const AST &region);
+  void finish_code();
+
+  // Run LLVM's standard O2 optimization pipeline for the host CPU on the
+  // generated module (after generate_code / finish_code).
+  void optimize_module();
+
+  // Hand over the generated module and its context, e.g. to a JIT.
+  // Must be called at most once, after generate_code; take the module before
+  // the context. Whatever is not taken is freed with the visitor.
+  std::unique_ptr<llvm::Module> take_module();
+  std::unique_ptr<llvm::LLVMContext> take_context();
+
   void write_object_file(std::string out_file);
 };
 
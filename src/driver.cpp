@@ -5,41 +5,222 @@ Driver of the bfllvm compiler, containing the main function.
  */
 
 #include "code_gen.h"
+#include "jit.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "runner.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 using namespace bfllvm;
 
+// upper bound of --jobs, per hardware thread
+const unsigned MAX_JOBS_PER_CORE = 4;
+
+void print_usage() {
+  std::cout << "Compiler to transform bf code to llvm bitcode.\n"
+            << "Copyright 2024, Andreas Gaiser (doraeneko@github)\n\n"
+            << "Usage example: bfllvm --out output.bc  < program.bf\n\n"
+            << "If --out / -o is not given, bf.bc is the output file.\n"
+            << "Instead of reading stdin, a source file can be given:\n"
+            << "bfllvm --out output.bc program.bf\n"
+            << "Use e.g. lli output.bc to execute the bitcode file, or\n"
+            << "use llc and gcc to compute a native executable.\n\n"
+            << "bfllvm --run program.bf < input\n"
+            << "compiles program.bf in memory and executes it directly.\n\n"
+            << "bfllvm --run program.bf --records [--input file]\n"
+            << "       [--delimiter c] [--jobs n]\n"
+            << "runs program.bf once per record of the input (stdin or file),\n"
+            << "records being separated by c (default: newline; \\n, \\t and\n"
+            << "\\0 are understood), using n threads (default or 0: one per\n"
+            << "core, at most " << MAX_JOBS_PER_CORE << " per core).\n"
+            << "The outputs are written in order, each followed by c.\n\n"
+            << "-g adds debug information (source lines and columns) for\n"
+            << "debuggers and profilers like perf.\n"
+            << "-O runs LLVM's optimization pipeline for the host CPU on the\n"
+            << "generated code." << std::endl;
+}
+
+// parse a record delimiter given on the command line
+bool parse_delimiter(const std::string &arg, char &delimiter) {
+  if (arg == "\\n") {
+    delimiter = '\n';
+  } else if (arg == "\\t") {
+    delimiter = '\t';
+  } else if (arg == "\\0") {
+    delimiter = '\0';
+  } else if (arg.size() == 1) {
+    delimiter = arg[0];
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// parse a number of worker threads given on the command line; 0 stands for
+// one per core, more than MAX_JOBS_PER_CORE per core are rejected
+bool parse_jobs(const std::string &arg, unsigned &jobs) {
+  if (arg.empty() || arg.size() > 9 ||
+      !std::all_of(arg.begin(), arg.end(),
+                   [](unsigned char c) { return std::isdigit(c); })) {
+    return false;
+  }
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  const unsigned long value = std::stoul(arg);
+  if (value > MAX_JOBS_PER_CORE * cores) {
+    return false;
+  }
+  jobs = value;
+  return true;
+}
+
+// JIT compile the program in file run_file; nullptr on errors
+std::shared_ptr<const Compiled_Program>
+compile_program(const std::string &run_file, const bool debug_info) {
+  std::ifstream source{run_file};
+  if (!source) {
+    std::cout << "Could not open " << run_file << std::endl;
+    return nullptr;
+  }
+  const auto result = Jit_Compiler{debug_info}.compile(source, run_file);
+  if (result.program == nullptr) {
+    std::cout << result.error << std::endl;
+  }
+  return result.program;
+}
+
+// JIT compile the program in file run_file and execute it once per record
+// read from input_file (stdin if empty), in parallel
+int run_records(const std::string &run_file, const bool debug_info,
+                const std::string &input_file, const char delimiter,
+                const unsigned jobs) {
+  const auto program = compile_program(run_file, debug_info);
+  if (program == nullptr) {
+    return 1;
+  }
+  std::ios::sync_with_stdio(false);
+  std::ifstream input_stream;
+  if (!input_file.empty()) {
+    input_stream.open(input_file, std::ios::binary);
+    if (!input_stream) {
+      std::cout << "Could not open " << input_file << std::endl;
+      return 1;
+    }
+  }
+  std::istream &input = input_file.empty() ? std::cin : input_stream;
+  if (Parallel_Runner{program, jobs}.run(input, std::cout, delimiter) !=
+      Run_Status::OK) {
+    std::cout << "Could not allocate the tapes" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// JIT compile the program in file run_file and execute it, reading its
+// input from stdin
+int run_program(const std::string &run_file, const bool debug_info) {
+  const auto program = compile_program(run_file, debug_info);
+  if (program == nullptr) {
+    return 1;
+  }
+  program->run(std::cin, std::cout);
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
-  std::stringstream ss;
-  std::string line;
   std::string out_file = "bf.bc";
+  std::string source_file;
+  std::string run_file;
+  bool debug_info = false;
+  bool optimize = false;
+  bool records = false;
+  std::string input_file;
+  char delimiter = '\n';
+  unsigned jobs = 0;
+  // --input, --delimiter or --jobs given
+  bool record_options = false;
 
-  if (argc == 3 &&
-      (argv[1] == std::string("--out") || argv[1] == std::string("-o"))) {
-    out_file = argv[2];
-  } else if (argc != 1) {
-    std::cout << "Compiler to transform bf code to llvm bitcode.\n"
-              << "Copyright 2024, Andreas Gaiser (doraeneko@github)\n\n"
-              << "Usage example: bfllvm --out output.bc  < program.bf\n\n"
-              << "If --out / -o is not given, bf.bc is the output file.\n"
-              << "Use e.g. lli output.bc to execute the bitcode file, or\n"
-              << "use llc and gcc to compute a native executable." << std::endl;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if ((arg == "--out" || arg == "-o") && i + 1 < argc) {
+      out_file = argv[++i];
+    } else if (arg == "--run" && i + 1 < argc) {
+      run_file = argv[++i];
+    } else if (arg == "--records") {
+      records = true;
+    } else if (arg == "--input" && i + 1 < argc) {
+      input_file = argv[++i];
+      record_options = true;
+    } else if (arg == "--delimiter" && i + 1 < argc &&
+               parse_delimiter(argv[i + 1], delimiter)) {
+      ++i;
+      record_options = true;
+    } else if (arg == "--jobs" && i + 1 < argc &&
+               parse_jobs(argv[i + 1], jobs)) {
+      ++i;
+      record_options = true;
+    } else if (arg == "-g") {
+      debug_info = true;
+    } else if (arg == "-O") {
+      optimize = true;
+    } else if (source_file.empty() && !arg.empty() && arg[0] != '-') {
+      source_file = arg;
+    } else {
+      print_usage();
+      return 0;
+    }
+  }
+  // record options only make sense for --run with --records
+  if ((records && run_file.empty()) || (record_options && !records)) {
+    print_usage();
     return 0;
   }
-  while (std::getline(std::cin, line)) {
-    ss << line << "\n";
+  if (!run_file.empty() && records) {
+    return run_records(run_file, debug_info, input_file, delimiter, jobs);
   }
-  Parser p{ss};
-  const auto ast = p.parse();
-  if (ast == nullptr) {
-    std::cout << "Parsing error: " << p.state() << std::endl;
-    return 1;
+  if (!run_file.empty()) {
+    return run_program(run_file, debug_info);
+  }
+
+  std::ios::sync_with_stdio(false);
+  std::ifstream source_stream;
+  if (!source_file.empty()) {
+    source_stream.open(source_file);
+    if (!source_stream) {
+      std::cout << "Could not open " << source_file << std::endl;
+      return 1;
+    }
+  }
+  std::istream &source = source_file.empty() ? std::cin : source_stream;
+
+  // compile the program region by region while it is read, so neither the
+  // source text nor the AST of more than the current top-level loop is kept
+  // in memory; the generated module still grows with the program
+  Parser p{source};
+  Optimizer optimizer;
+  Code_Gen_Visitor cgv;
+  if (debug_info) {
+    cgv.set_debug_info(source_file.empty() ? "<stdin>" : source_file);
+  }
+  cgv.begin_code();
+  while (!p.finished()) {
+    const auto region = p.parse_region();
+    if (region == nullptr) {
+      std::cout << "Parsing error: " << p.state() << std::endl;
+      return 1;
+    }
+    cgv.generate_region(optimizer.optimize_region(region));
+  }
+  cgv.generate_region(optimizer.finish());
+  cgv.finish_code();
+  if (optimize) {
+    cgv.optimize_module();
   }
-  Code_Gen_Visitor cgv(ast);
-  cgv.generate_code();
   cgv.write_object_file(out_file);
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,205 @@
+/*
+bfllvm
+(C) Andreas Gaiser (doraeneko@github.com), 2024
+JIT compilation of bf programs into callable functions, for embedding
+bfllvm into other applications.
+*/
+
+#include "jit.h"
+#include "code_gen.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Support/Error.h"
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+using namespace llvm;
+
+namespace bfllvm {
+
+namespace {
+// I/O state of a single run, passed to the compiled code as opaque pointer
+struct IO_State {
+  const std::uint8_t *input{nullptr};
+  std::size_t input_size{0};
+  std::size_t input_position{0};
+  std::uint8_t *output{nullptr};
+  std::size_t output_capacity{0};
+  std::size_t output_size{0};
+  // if set, output is appended here instead of to output
+  std::string *output_string{nullptr};
+  // if set, input is read from and output written to these streams instead
+  std::istream *input_stream{nullptr};
+  std::ostream *output_stream{nullptr};
+  bool output_overflow{false};
+};
+} // namespace
+
+extern "C" std::int32_t bfllvm_get_char(void *io) {
+  auto *state = static_cast<IO_State *>(io);
+  if (state->input_stream != nullptr) {
+    const auto value = state->input_stream->get();
+    return state->input_stream ? value : EOF;
+  }
+  if (state->input_position >= state->input_size) {
+    return EOF;
+  }
+  return state->input[state->input_position++];
+}
+
+extern "C" std::int32_t bfllvm_put_char(void *io, std::int32_t value) {
+  auto *state = static_cast<IO_State *>(io);
+  if (state->output_stream != nullptr) {
+    // flush each character, like the compiled executable does
+    state->output_stream->put(static_cast<char>(value)).flush();
+  } else if (state->output_string != nullptr) {
+    state->output_string->push_back(static_cast<char>(value));
+  } else if (state->output_size < state->output_capacity) {
+    state->output[state->output_size++] = static_cast<std::uint8_t>(value);
+  } else {
+    state->output_overflow = true;
+  }
+  return value;
+}
+
+Compiled_Program::Compiled_Program(std::unique_ptr<orc::LLJIT> jit,
+                                   Entry_Function entry)
+    : _jit{std::move(jit)}, _entry{entry} {}
+
+Compiled_Program::~Compiled_Program() = default;
+
+Run_Status Compiled_Program::run(const std::uint8_t *input,
+                                 std::size_t input_size, std::uint8_t *output,
+                                 std::size_t output_capacity,
+                                 std::size_t &output_size, std::uint8_t *tape,
+                                 std::size_t tape_size) const {
+  output_size = 0;
+  if (tape_size < BF_ARRAY_SIZE) {
+    return Run_Status::TAPE_TOO_SMALL;
+  }
+  IO_State state;
+  state.input = input;
+  state.input_size = input_size;
+  state.output = output;
+  state.output_capacity = output_capacity;
+  _entry(tape, &state);
+  output_size = state.output_size;
+  return state.output_overflow ? Run_Status::OUTPUT_OVERFLOW : Run_Status::OK;
+}
+
+Run_Status Compiled_Program::run(const std::string &input,
+                                 std::string &output) const {
+  std::vector<std::uint8_t> tape(BF_ARRAY_SIZE, 0);
+  return run(input, output, tape.data(), tape.size());
+}
+
+Run_Status Compiled_Program::run(const std::string &input, std::string &output,
+                                 std::uint8_t *tape,
+                                 std::size_t tape_size) const {
+  if (tape_size < BF_ARRAY_SIZE) {
+    return Run_Status::TAPE_TOO_SMALL;
+  }
+  IO_State state;
+  state.input = reinterpret_cast<const std::uint8_t *>(input.data());
+  state.input_size = input.size();
+  state.output_string = &output;
+  _entry(tape, &state);
+  return Run_Status::OK;
+}
+
+Run_Status Compiled_Program::run(std::istream &input,
+                                 std::ostream &output) const {
+  std::vector<std::uint8_t> tape(BF_ARRAY_SIZE, 0);
+  IO_State state;
+  state.input_stream = &input;
+  state.output_stream = &output;
+  _entry(tape.data(), &state);
+  return Run_Status::OK;
+}
+
+Compile_Result Jit_Compiler::compile(const std::string &source,
+                                     const std::string &source_name) const {
+  std::stringstream ss{source};
+  return compile(ss, source_name);
+}
+
+Compile_Result Jit_Compiler::compile(std::istream &source,
+                                     const std::string &source_name) const {
+  Parser p{source};
+  Optimizer optimizer;
+  Code_Gen_Visitor cgv(Code_Gen_Target::EMBEDDED);
+  if (_debug_info) {
+    cgv.set_debug_info(source_name);
+  }
+  cgv.begin_code();
+  while (!p.finished()) {
+    const auto region = p.parse_region();
+    if (region == nullptr) {
+      return {nullptr, "Parsing error: " + p.state()};
+    }
+    cgv.generate_region(optimizer.optimize_region(region));
+  }
+  cgv.generate_region(optimizer.finish());
+  cgv.finish_code();
+  // compiled programs are meant to be run many times, so optimize them
+  cgv.optimize_module();
+  auto module = cgv.take_module();
+  auto context = cgv.take_context();
+
+  orc::LLJITBuilder builder;
+  if (_debug_info) {
+    // link via RuntimeDyld, which can notify the debugger and profiler
+    // listeners about the generated code
+    builder.setObjectLinkingLayerCreator(
+        [](orc::ExecutionSession &session, const Triple &) {
+          auto layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(
+              session, [](auto &&...) {
+                return std::make_unique<SectionMemoryManager>();
+              });
+          layer->registerJITEventListener(
+              *JITEventListener::createGDBRegistrationListener());
+          if (auto *perf = JITEventListener::createPerfJITEventListener()) {
+            layer->registerJITEventListener(*perf);
+          }
+          return layer;
+        });
+  }
+  auto jit = builder.create();
+  if (!jit) {
+    return {nullptr, "JIT error: " + toString(jit.takeError())};
+  }
+
+  // make the host I/O functions visible to the compiled code
+  auto &session = (*jit)->getExecutionSession();
+  orc::MangleAndInterner mangle(session, (*jit)->getDataLayout());
+  orc::SymbolMap host_symbols;
+  host_symbols[mangle("bfllvm_get_char")] = {
+      orc::ExecutorAddr::fromPtr(&bfllvm_get_char), JITSymbolFlags::Exported};
+  host_symbols[mangle("bfllvm_put_char")] = {
+      orc::ExecutorAddr::fromPtr(&bfllvm_put_char), JITSymbolFlags::Exported};
+  if (auto err = (*jit)->getMainJITDylib().define(
+          orc::absoluteSymbols(std::move(host_symbols)))) {
+    return {nullptr, "JIT error: " + toString(std::move(err))};
+  }
+
+  if (auto err = (*jit)->addIRModule(
+          orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+    return {nullptr, "JIT error: " + toString(std::move(err))};
+  }
+  auto entry = (*jit)->lookup(BF_RUN_FUNCTION_NAME);
+  if (!entry) {
+    return {nullptr, "JIT error: " + toString(entry.takeError())};
+  }
+  return {std::make_shared<const Compiled_Program>(
+              std::move(*jit),
+              entry->toPtr<Compiled_Program::Entry_Function>()),
+          ""};
+}
+
+} // namespace bfllvm
@@ -0,0 +1,109 @@
+/*
+bfllvm
+(C) Andreas Gaiser (doraeneko@github.com), 2024
+JIT compilation of bf programs into callable functions, for embedding
+bfllvm into other applications.
+*/
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "tape.h"
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace llvm {
+namespace orc {
+class LLJIT;
+}
+} // namespace llvm
+
+namespace bfllvm {
+
+// Outcome of running a compiled program.
+enum class Run_Status : std::uint32_t {
+  OK = 0,
+  // the output buffer was too small, surplus output has been dropped
+  OUTPUT_OVERFLOW,
+  // the tape given has less than BF_ARRAY_SIZE cells, nothing was executed
+  TAPE_TOO_SMALL,
+  // no memory could be mapped for the tapes, nothing was executed
+  TAPE_UNAVAILABLE
+};
+
+// A bf program compiled to native code. Running it does not change the
+// object, so a single instance may be run by many threads at the same time,
+// as long as each run gets its own tape and buffers.
+class Compiled_Program {
+public:
+  typedef std::int32_t (*Entry_Function)(std::uint8_t *tape, void *io);
+
+private:
+  std::unique_ptr<llvm::orc::LLJIT> _jit;
+  Entry_Function _entry;
+
+public:
+  Compiled_Program(std::unique_ptr<llvm::orc::LLJIT> jit,
+                   Entry_Function entry);
+
+  // Run the program on the given tape, which must have at least
+  // BF_ARRAY_SIZE cells; the pointer starts at tape[0]. ',' reads the next
+  // byte of input (255 once the input is exhausted, like EOF for the
+  // compiled executable), '.' appends a byte to output. output_size is set to
+  // the number of bytes written.
+  Run_Status run(const std::uint8_t *input, std::size_t input_size,
+                 std::uint8_t *output, std::size_t output_capacity,
+                 std::size_t &output_size, std::uint8_t *tape,
+                 std::size_t tape_size) const;
+
+  // Run the program on a fresh zeroed tape, appending all output to output.
+  Run_Status run(const std::string &input, std::string &output) const;
+
+  // Same, but on the given tape (at least BF_ARRAY_SIZE cells), which is
+  // used as is, so it can be reused for many runs.
+  Run_Status run(const std::string &input, std::string &output,
+                 std::uint8_t *tape, std::size_t tape_size) const;
+
+  // Run the program on a fresh zeroed tape, reading input from the stream
+  // only when the program asks for it and flushing each output byte, so that
+  // interactive programs work.
+  Run_Status run(std::istream &input, std::ostream &output) const;
+
+  virtual ~Compiled_Program();
+};
+
+// Result of Jit_Compiler::compile: program is nullptr if and only if the
+// compilation failed, error then describes why.
+struct Compile_Result {
+  std::shared_ptr<const Compiled_Program> program;
+  std::string error;
+};
+
+// Compiles bf source code into optimized Compiled_Program instances. A
+// compiler keeps no state between compilations, so a single instance may be
+// used by many threads at the same time.
+class Jit_Compiler {
+  const bool _debug_info;
+
+public:
+  // If debug_info is set, compiled programs carry DWARF line information
+  // referring to source_name (see compile) and are announced to gdb and,
+  // if LLVM supports it, to perf via its JIT interface.
+  Jit_Compiler(const bool debug_info = false) : _debug_info{debug_info} {}
+
+  // Compile the given program.
+  Compile_Result compile(std::istream &source,
+                         const std::string &source_name = "<input>") const;
+  Compile_Result compile(const std::string &source,
+                         const std::string &source_name = "<input>") const;
+
+  virtual ~Jit_Compiler() = default;
+};
+
+} // namespace bfllvm
+
+#endif
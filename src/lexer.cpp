@@ -13,7 +13,13 @@ namespace bfllvm {
 Token Lexer::get_next() {
   if (!_stream.eof()) {
     const auto next = this->peek();
-    _stream.get();
+    _token_location = _location;
+    if (_stream.get() == '\n') {
+      ++_location.line;
+      _location.column = 1;
+    } else {
+      ++_location.column;
+    }
     return next;
   }
   return Token::END;
@@ -7,6 +7,7 @@ Lexer for bfllvm.
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "ast.h"
 #include <cstdint>
 #include <istream>
 
@@ -27,14 +28,21 @@ enum class Token : std::uint32_t {
 
 class Lexer {
   std::istream &_stream;
+  // position of the next character in the stream
+  Source_Location _location;
+  // position of the token last returned by get_next
+  Source_Location _token_location;
 
 public:
-  Lexer(std::istream &stream) : _stream(stream) {}
+  Lexer(std::istream &stream)
+      : _stream(stream), _location{1, 1}, _token_location{} {}
 
   // remove next token from stream and return it
   Token get_next();
   // just peek the next token
   Token peek();
+  // source position of the token last returned by get_next
+  inline Source_Location location() const { return _token_location; }
 
   virtual ~Lexer() = default;
 };
@@ -0,0 +1,287 @@
+/*
+bfllvm
+(C) Andreas Gaiser (doraeneko@github.com), 2024
+AST optimizations for bfllvm: folding of straight-line runs into cell block
+updates, recognition of multiply-add loops and of counted loops.
+*/
+
+#include "optimizer.h"
+#include <algorithm>
+#include <set>
+
+namespace bfllvm {
+
+namespace {
+// multiplicative inverse of an odd value modulo 256
+std::uint8_t inverse_mod_256(const std::uint8_t value) {
+  std::uint8_t result = 1;
+  while (static_cast<std::uint8_t>(result * value) != 1) {
+    result += 2;
+  }
+  return result;
+}
+
+// Cells read and written by an optimized loop body, as offsets relative to
+// the pointer at the start of the body. Changes by block updates directly in
+// the body are summed up in deltas; inside nested loops they are writes, as
+// their number of executions is unknown.
+class Cell_Access_Analysis : public AST_Visitor {
+  bool _nested{false};
+
+  void visit_loop(const Sequence &v) {
+    reads.insert(position);
+    writes.insert(position);
+    const auto start = position;
+    const bool was_nested = _nested;
+    _nested = true;
+    visit(v);
+    _nested = was_nested;
+    if (position != start) {
+      known_position = false;
+    }
+  }
+
+  void update(const std::int32_t offset, const Cell_Update &update) {
+    if (update.clear || _nested) {
+      writes.insert(offset);
+    } else {
+      deltas[offset] += update.delta;
+    }
+  }
+
+public:
+  std::int32_t position{0};
+  // false if the pointer moves by a statically unknown amount
+  bool known_position{true};
+  std::set<std::int32_t> reads;
+  std::set<std::int32_t> writes;
+  std::map<std::int32_t, std::uint8_t> deltas;
+
+  void visit(const Sequence &v) override {
+    for (const auto &element : v.get_inner()) {
+      element->accept(*this);
+    }
+  }
+  void visit(const While_Loop &v) override { visit_loop(v); }
+  void visit(const Counted_Loop &v) override { visit_loop(v); }
+  void visit(const Pointer_Decrement &v) override { --position; }
+  void visit(const Pointer_Increment &v) override { ++position; }
+  void visit(const Value_Decrement &v) override {
+    update(position, Cell_Update{false, 255});
+  }
+  void visit(const Value_Increment &v) override {
+    update(position, Cell_Update{false, 1});
+  }
+  void visit(const Put_Char &v) override { reads.insert(position); }
+  void visit(const Get_Char &v) override { writes.insert(position); }
+  void visit(const Cell_Block_Update &v) override {
+    for (const auto &[offset, cell] : v.get_cells()) {
+      update(position + offset, cell);
+    }
+    position += v.get_pointer_move();
+  }
+  void visit(const Multiply_Add_Loop &v) override {
+    reads.insert(position);
+    writes.insert(position);
+    for (const auto &factor : v.get_factors()) {
+      writes.insert(position + factor.first);
+    }
+  }
+};
+
+// Copy of a balanced optimized loop body without the block updates of the
+// control cell (offset 0).
+std::shared_ptr<Sequence> without_control_updates(const Sequence &body) {
+  auto result = std::make_shared<Sequence>();
+  std::int32_t position = 0;
+  for (const auto &element : body.get_inner()) {
+    const auto block = std::dynamic_pointer_cast<Cell_Block_Update>(element);
+    if (block == nullptr) {
+      // nested loops are balanced, other commands do not move the pointer
+      result->push_back(element);
+      continue;
+    }
+    auto cells = block->get_cells();
+    cells.erase(-position);
+    if (!cells.empty() || block->get_pointer_move() != 0) {
+      auto new_block =
+          std::make_shared<Cell_Block_Update>(cells, block->get_pointer_move());
+      new_block->set_location(block->get_location());
+      result->push_back(new_block);
+    }
+    position += block->get_pointer_move();
+  }
+  return result;
+}
+} // namespace
+
+std::shared_ptr<Sequence> Optimizer::optimize(const AST &ast) {
+  _result = std::make_shared<Sequence>();
+  _cells.clear();
+  _pointer_move = 0;
+  ast->accept(*this);
+  flush();
+  return _result;
+}
+
+std::shared_ptr<Sequence> Optimizer::optimize_region(const AST &region) {
+  _result = std::make_shared<Sequence>();
+  region->accept(*this);
+  return _result;
+}
+
+std::shared_ptr<Sequence> Optimizer::finish() {
+  _result = std::make_shared<Sequence>();
+  flush();
+  return _result;
+}
+
+void Optimizer::extend_run(const AST_Element &v) {
+  if (_cells.empty() && _pointer_move == 0) {
+    _run_location = v.get_location();
+  }
+}
+
+void Optimizer::append(const AST &element, const AST_Element &v) {
+  element->set_location(v.get_location());
+  _result->push_back(element);
+}
+
+void Optimizer::flush() {
+  for (auto it = _cells.begin(); it != _cells.end();) {
+    // drop cells whose updates cancelled out, e.g. +-
+    if (!it->second.clear && it->second.delta == 0) {
+      it = _cells.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (!_cells.empty() || _pointer_move != 0) {
+    auto block = std::make_shared<Cell_Block_Update>(_cells, _pointer_move);
+    block->set_location(_run_location);
+    _result->push_back(block);
+  }
+  _cells.clear();
+  _pointer_move = 0;
+}
+
+void Optimizer::visit(const Pointer_Decrement &v) {
+  extend_run(v);
+  --_pointer_move;
+}
+
+void Optimizer::visit(const Pointer_Increment &v) {
+  extend_run(v);
+  ++_pointer_move;
+}
+
+void Optimizer::visit(const Value_Decrement &v) {
+  extend_run(v);
+  --_cells[_pointer_move].delta;
+}
+
+void Optimizer::visit(const Value_Increment &v) {
+  extend_run(v);
+  ++_cells[_pointer_move].delta;
+}
+
+void Optimizer::visit(const Put_Char &v) {
+  flush();
+  append(std::make_shared<Put_Char>(), v);
+}
+
+void Optimizer::visit(const Get_Char &v) {
+  flush();
+  append(std::make_shared<Get_Char>(), v);
+}
+
+void Optimizer::visit(const Sequence &v) {
+  for (const auto &element : v.get_inner()) {
+    element->accept(*this);
+  }
+}
+
+void Optimizer::visit(const While_Loop &v) {
+  Optimizer inner;
+  inner.visit(static_cast<const Sequence &>(v));
+  inner.flush();
+  const auto &body = inner._result->get_inner();
+
+  // a balanced body consisting of a single block update without clears,
+  // which changes the control cell by an odd amount, runs exactly
+  // (-*ptr * inverse(delta)) mod 256 times: a clear or multiply-add loop.
+  if (body.size() == 1) {
+    const auto block = std::dynamic_pointer_cast<Cell_Block_Update>(body[0]);
+    if (block != nullptr && block->get_pointer_move() == 0) {
+      const auto &cells = block->get_cells();
+      const auto control = cells.find(0);
+      const bool no_clears =
+          std::none_of(cells.begin(), cells.end(),
+                       [](const auto &cell) { return cell.second.clear; });
+      if (no_clears && control != cells.end() &&
+          control->second.delta % 2 == 1) {
+        if (cells.size() == 1) {
+          extend_run(v);
+          _cells[_pointer_move] = Cell_Update{true, 0};
+          return;
+        }
+        const auto scale = static_cast<std::uint8_t>(
+            -inverse_mod_256(control->second.delta));
+        std::map<std::int32_t, std::uint8_t> factors;
+        for (const auto &[offset, update] : cells) {
+          if (offset != 0) {
+            factors[offset] = static_cast<std::uint8_t>(scale * update.delta);
+          }
+        }
+        flush();
+        append(std::make_shared<Multiply_Add_Loop>(factors), v);
+        return;
+      }
+    }
+  }
+
+  // more generally, a balanced body (with balanced nested loops) that
+  // changes the control cell only by block updates adding an odd amount per
+  // iteration, is a counted loop
+  Cell_Access_Analysis analysis;
+  analysis.visit(*inner._result);
+  const auto control = analysis.deltas.find(0);
+  if (analysis.known_position && analysis.position == 0 &&
+      analysis.writes.count(0) == 0 && control != analysis.deltas.end() &&
+      control->second % 2 == 1) {
+    const auto trip_scale =
+        static_cast<std::uint8_t>(-inverse_mod_256(control->second));
+    // keep the control cell up to date only if the body looks at it
+    const auto counted_body = analysis.reads.count(0) != 0
+                                  ? inner._result
+                                  : without_control_updates(*inner._result);
+    flush();
+    append(std::make_shared<Counted_Loop>(*counted_body, trip_scale), v);
+    return;
+  }
+  flush();
+  append(std::make_shared<While_Loop>(*inner._result), v);
+}
+
+void Optimizer::visit(const Counted_Loop &v) {
+  Optimizer inner;
+  inner.visit(static_cast<const Sequence &>(v));
+  inner.flush();
+  flush();
+  append(std::make_shared<Counted_Loop>(*inner._result, v.get_trip_scale()),
+         v);
+}
+
+void Optimizer::visit(const Cell_Block_Update &v) {
+  flush();
+  append(
+      std::make_shared<Cell_Block_Update>(v.get_cells(), v.get_pointer_move()),
+      v);
+}
+
+void Optimizer::visit(const Multiply_Add_Loop &v) {
+  flush();
+  append(std::make_shared<Multiply_Add_Loop>(v.get_factors()), v);
+}
+
+} // namespace bfllvm
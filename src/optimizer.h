@@ -0,0 +1,62 @@
+/*
+bfllvm
+(C) Andreas Gaiser (doraeneko@github.com), 2024
+AST optimizations for bfllvm: folding of straight-line runs into cell block
+updates, recognition of multiply-add loops and of counted loops.
+*/
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ast.h"
+
+namespace bfllvm {
+
+class Optimizer : public AST_Visitor {
+  std::shared_ptr<Sequence> _result;
+
+  // pending straight-line run, not yet emitted into _result
+  std::map<std::int32_t, Cell_Update> _cells;
+  std::int32_t _pointer_move{0};
+  // source location of the first command of the pending run
+  Source_Location _run_location;
+
+  // note v as part of the pending run (its first command, if it is empty)
+  void extend_run(const AST_Element &v);
+  // append element to _result, taking over the source location of v
+  void append(const AST &element, const AST_Element &v);
+
+  // emit the pending run as a Cell_Block_Update (if it has any effect)
+  void flush();
+
+  void visit(const Pointer_Decrement &v) override;
+  void visit(const Pointer_Increment &v) override;
+  void visit(const Value_Decrement &v) override;
+  void visit(const Value_Increment &v) override;
+  void visit(const Put_Char &v) override;
+  void visit(const Get_Char &v) override;
+  void visit(const Sequence &v) override;
+  void visit(const While_Loop &v) override;
+  void visit(const Cell_Block_Update &v) override;
+  void visit(const Multiply_Add_Loop &v) override;
+  void visit(const Counted_Loop &v) override;
+
+public:
+  Optimizer() : _result{std::make_shared<Sequence>()} {}
+
+  // Return an optimized copy of the given program; the input is not changed.
+  std::shared_ptr<Sequence> optimize(const AST &ast);
+
+  // Streaming alternative to optimize for consecutive regions of a program:
+  // return the optimized elements of region, except for a straight-line run
+  // at its end, which is kept pending and folded with the start of the next
+  // region. finish returns what is still pending after the last region.
+  std::shared_ptr<Sequence> optimize_region(const AST &region);
+  std::shared_ptr<Sequence> finish();
+
+  virtual ~Optimizer() = default;
+};
+
+} // namespace bfllvm
+
+#endif
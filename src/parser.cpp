@@ -10,48 +10,88 @@ namespace bfllvm {
 
 AST Parser::parse() { return parse_sequence(false); }
 
-std::shared_ptr<Sequence> Parser::parse_sequence(const bool inner_loop) {
+AST Parser::parse_region() {
   auto result = std::make_shared<Sequence>();
 
-  Token token;
-  while ((token = _lexer.get_next()) != Token::END) {
-    switch (token) {
-    case Token::PTR_INC: {
-      result->push_back(std::make_shared<Pointer_Increment>());
-      break;
-    }
-    case Token::PTR_DEC: {
-      result->push_back(std::make_shared<Pointer_Decrement>());
-      break;
-    }
-    case Token::VAL_INC: {
-      result->push_back(std::make_shared<Value_Increment>());
-      break;
-    }
-    case Token::VAL_DEC: {
-      result->push_back(std::make_shared<Value_Decrement>());
-      break;
+  Token token = Token::OTHER;
+  while (result->size() < MAX_REGION_SIZE &&
+         (token = _lexer.get_next()) != Token::END) {
+    if (token == Token::WHILE_END) {
+      _state = "Expected an opening '['";
+      return nullptr;
     }
-    case Token::PUT_CHAR: {
-      result->push_back(std::make_shared<Put_Char>());
-      break;
+    if (!parse_command(token, _lexer.location(), *result)) {
+      return nullptr;
     }
-    case Token::GET_CHAR: {
-      result->push_back(std::make_shared<Get_Char>());
-      break;
+    if (token == Token::WHILE_START) {
+      // top-level loop complete, hand out the region
+      return result;
     }
-    case Token::WHILE_START: {
-      // start of while already consumed, parse the inner part.
-      auto inner_seq = parse_sequence(true);
-      if (inner_seq == nullptr) {
-        // error, return; _state has been already set.
-        return nullptr;
-      }
-      auto while_loop = std::make_shared<While_Loop>(*inner_seq);
-      result->push_back(while_loop);
-      break;
+  }
+  if (token == Token::END) {
+    _finished = true;
+  }
+  return result;
+}
+
+bool Parser::parse_command(const Token token, const Source_Location &location,
+                           Sequence &result) {
+  AST element;
+  switch (token) {
+  case Token::PTR_INC: {
+    element = std::make_shared<Pointer_Increment>();
+    break;
+  }
+  case Token::PTR_DEC: {
+    element = std::make_shared<Pointer_Decrement>();
+    break;
+  }
+  case Token::VAL_INC: {
+    element = std::make_shared<Value_Increment>();
+    break;
+  }
+  case Token::VAL_DEC: {
+    element = std::make_shared<Value_Decrement>();
+    break;
+  }
+  case Token::PUT_CHAR: {
+    element = std::make_shared<Put_Char>();
+    break;
+  }
+  case Token::GET_CHAR: {
+    element = std::make_shared<Get_Char>();
+    break;
+  }
+  case Token::WHILE_START: {
+    // start of while already consumed, parse the inner part.
+    auto inner_seq = parse_sequence(true);
+    if (inner_seq == nullptr) {
+      // error, return; _state has been already set.
+      return false;
     }
-    case Token::WHILE_END: {
+    element = std::make_shared<While_Loop>(*inner_seq);
+    break;
+  }
+  case Token::OTHER: {
+    // just ignore
+    return true;
+  }
+  default: {
+    _state = "unhandled parsing error detected.";
+    return false;
+  }
+  }
+  element->set_location(location);
+  result.push_back(element);
+  return true;
+}
+
+std::shared_ptr<Sequence> Parser::parse_sequence(const bool inner_loop) {
+  auto result = std::make_shared<Sequence>();
+
+  Token token;
+  while ((token = _lexer.get_next()) != Token::END) {
+    if (token == Token::WHILE_END) {
       if (inner_loop) {
         return result;
       } else {
@@ -59,15 +99,9 @@ std::shared_ptr<Sequence> Parser::parse_sequence(const bool inner_loop) {
         return nullptr;
       }
     }
-    case Token::OTHER: {
-      // just ignore
-      break;
-    }
-    default: {
-      _state = "unhandled parsing error detected.";
+    if (!parse_command(token, _lexer.location(), *result)) {
       return nullptr;
     }
-    }
   }
   if (token == Token::END && inner_loop) {
     _state = "Expected a closing ']'";
@@ -12,21 +12,39 @@ Primitive RD parser for bfllvm.
 
 namespace bfllvm {
 
+// maximal number of top-level commands in a region, see parse_region
+const std::uint32_t MAX_REGION_SIZE = 4096;
+
 class Parser {
   Lexer _lexer;
   std::string _state;
+  bool _finished;
   // parse a sequence of commands. If inner_loop is true,
   // a "]" is expected to be eventually read as sequence terminator.
   std::shared_ptr<Sequence> parse_sequence(const bool inner_loop);
+  // parse the command starting with token (not "]") at the given source
+  // location and append it to result. Returns false on errors.
+  bool parse_command(const Token token, const Source_Location &location,
+                     Sequence &result);
 
 public:
-  Parser(std::istream &stream) : _lexer(stream), _state{"ok"} {}
+  Parser(std::istream &stream)
+      : _lexer(stream), _state{"ok"}, _finished{false} {}
 
   // Try to parse the program given by the initially provided stream.
   // If parsing is successful, an AST value != nullptr is returned;
   // otherwise nulllptr is returned and an error can be read from the status
   AST parse();
 
+  // Streaming alternative to parse: read only the next region of top-level
+  // commands from the stream, ending after the next complete top-level loop
+  // (or after MAX_REGION_SIZE commands, or at the end of the stream), so
+  // neither the source text nor the AST of earlier regions is buffered.
+  // Returns nullptr on errors, like parse. Call until finished() is true.
+  AST parse_region();
+
+  inline bool finished() const { return _finished; }
+
   inline std::string state() { return _state; }
 
   virtual ~Parser() = default;
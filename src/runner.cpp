@@ -0,0 +1,244 @@
+/*
+bfllvm
+(C) Andreas Gaiser (doraeneko@github.com), 2024
+Data-parallel execution of a compiled bf program over many independent
+input records.
+*/
+
+#include "runner.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+namespace bfllvm {
+
+namespace {
+// records per worker thread that may be read ahead of the output when
+// reading a stream
+const std::size_t RECORDS_PER_JOB = 1024;
+
+// size of the inaccessible regions below and above each tape
+const std::size_t GUARD_SIZE = 1 << 20;
+
+// A tape of BF_ARRAY_SIZE cells, mapped between two inaccessible guard
+// regions: a run moving below its tape or past the page holding its last
+// cell crashes with a segmentation fault instead of silently corrupting
+// memory of the process, which all workers share. Moves further than
+// GUARD_SIZE past an end are not caught.
+class Guarded_Tape {
+  std::uint8_t *_mapping = nullptr;
+  std::size_t _mapping_size;
+  std::size_t _tape_size;
+
+public:
+  // If the memory cannot be mapped, the tape is not valid().
+  Guarded_Tape() {
+    const std::size_t page_size = sysconf(_SC_PAGESIZE);
+    _tape_size = (BF_ARRAY_SIZE + page_size - 1) / page_size * page_size;
+    _mapping_size = GUARD_SIZE + _tape_size + GUARD_SIZE;
+    // reserve everything inaccessible, then open up the tape in between
+    void *mapping = mmap(nullptr, _mapping_size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      return;
+    }
+    if (mprotect(static_cast<std::uint8_t *>(mapping) + GUARD_SIZE,
+                 _tape_size, PROT_READ | PROT_WRITE) != 0) {
+      munmap(mapping, _mapping_size);
+      return;
+    }
+    _mapping = static_cast<std::uint8_t *>(mapping);
+  }
+
+  Guarded_Tape(const Guarded_Tape &) = delete;
+  Guarded_Tape &operator=(const Guarded_Tape &) = delete;
+
+  ~Guarded_Tape() {
+    if (_mapping != nullptr) {
+      munmap(_mapping, _mapping_size);
+    }
+  }
+
+  inline bool valid() const { return _mapping != nullptr; }
+  inline std::uint8_t *data() { return _mapping + GUARD_SIZE; }
+  inline std::size_t size() const { return BF_ARRAY_SIZE; }
+
+  // zero all cells for the next run
+  inline void clear() { std::memset(data(), 0, _tape_size); }
+};
+
+// Map one tape per worker on the calling thread, before any worker starts;
+// false if that fails.
+bool allocate_tapes(const std::size_t count,
+                    std::vector<std::unique_ptr<Guarded_Tape>> &tapes) {
+  for (std::size_t i = 0; i < count; ++i) {
+    tapes.push_back(std::make_unique<Guarded_Tape>());
+    if (!tapes.back()->valid()) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+Parallel_Runner::Parallel_Runner(
+    std::shared_ptr<const Compiled_Program> program, unsigned jobs)
+    : _program{std::move(program)}, _jobs{jobs} {
+  if (_jobs == 0) {
+    _jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+Run_Status Parallel_Runner::run(const std::vector<std::string> &records,
+                                std::vector<std::string> &outputs) const {
+  const std::size_t workers =
+      std::min(static_cast<std::size_t>(_jobs), records.size());
+  std::vector<std::unique_ptr<Guarded_Tape>> tapes;
+  if (!allocate_tapes(workers, tapes)) {
+    return Run_Status::TAPE_UNAVAILABLE;
+  }
+  outputs.assign(records.size(), std::string());
+  // workers fetch the index of the next record to process,
+  // each worker has its own tape
+  std::atomic<std::size_t> next_record{0};
+  const auto worker = [&](Guarded_Tape &tape) {
+    std::size_t index;
+    while ((index = next_record++) < records.size()) {
+      tape.clear();
+      _program->run(records[index], outputs[index], tape.data(), tape.size());
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < workers; ++i) {
+    threads.emplace_back(worker, std::ref(*tapes[i]));
+  }
+  // the calling thread is one of the workers
+  if (workers > 0) {
+    worker(*tapes[0]);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return Run_Status::OK;
+}
+
+Run_Status Parallel_Runner::run(std::istream &input, std::ostream &output,
+                                const char delimiter) const {
+  std::vector<std::unique_ptr<Guarded_Tape>> tapes;
+  if (!allocate_tapes(_jobs, tapes)) {
+    return Run_Status::TAPE_UNAVAILABLE;
+  }
+  // The calling thread reads the records into a queue, numbering them in
+  // input order. A pool of _jobs workers runs the program on them, and a
+  // writer thread writes each output as soon as all earlier ones have been
+  // written. At most window records are read but not yet written, so memory
+  // use is bounded even while a single record takes long.
+  const std::size_t window = RECORDS_PER_JOB * _jobs;
+  std::mutex mutex;
+  // signalled when the queue gets a record or the input is exhausted
+  std::condition_variable work_available;
+  // signalled when the next output to write is ready or all are written
+  std::condition_variable output_ready;
+  // signalled when an output has been written, making room in the window
+  std::condition_variable window_available;
+  std::deque<std::pair<std::size_t, std::string>> queue;
+  std::map<std::size_t, std::string> outputs;
+  std::size_t records_read = 0;
+  std::size_t records_written = 0;
+  bool input_done = false;
+
+  const auto worker = [&](Guarded_Tape &tape) {
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true) {
+      work_available.wait(lock, [&] { return !queue.empty() || input_done; });
+      if (queue.empty()) {
+        return;
+      }
+      const std::size_t index = queue.front().first;
+      const std::string record = std::move(queue.front().second);
+      queue.pop_front();
+      lock.unlock();
+
+      std::string result;
+      tape.clear();
+      _program->run(record, result, tape.data(), tape.size());
+
+      lock.lock();
+      outputs.emplace(index, std::move(result));
+      if (index == records_written) {
+        output_ready.notify_one();
+      }
+    }
+  };
+
+  const auto writer = [&]() {
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true) {
+      if (outputs.count(records_written) == 0) {
+        // wait for a slow record with everything so far written out
+        lock.unlock();
+        output.flush();
+        lock.lock();
+      }
+      output_ready.wait(lock, [&] {
+        return outputs.count(records_written) != 0 ||
+               (input_done && records_written == records_read);
+      });
+      const auto next = outputs.find(records_written);
+      if (next == outputs.end()) {
+        return;
+      }
+      const std::string result = std::move(next->second);
+      outputs.erase(next);
+      lock.unlock();
+
+      output.write(result.data(), result.size());
+      output.put(delimiter);
+
+      lock.lock();
+      ++records_written;
+      window_available.notify_one();
+    }
+  };
+
+  // reading must not flush a tied output stream, the writer owns it
+  std::ostream *const tied = input.tie(nullptr);
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < _jobs; ++i) {
+    threads.emplace_back(worker, std::ref(*tapes[i]));
+  }
+  threads.emplace_back(writer);
+
+  std::string record;
+  while (std::getline(input, record, delimiter)) {
+    std::unique_lock<std::mutex> lock{mutex};
+    window_available.wait(
+        lock, [&] { return records_read - records_written < window; });
+    queue.emplace_back(records_read++, std::move(record));
+    work_available.notify_one();
+  }
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    input_done = true;
+  }
+  work_available.notify_all();
+  output_ready.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  input.tie(tied);
+  output.flush();
+  return Run_Status::OK;
+}
+
+} // namespace bfllvm
@@ -0,0 +1,61 @@
+/*
+bfllvm
+(C) Andreas Gaiser (doraeneko@github.com), 2024
+Data-parallel execution of a compiled bf program over many independent
+input records.
+*/
+
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include "jit.h"
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace bfllvm {
+
+// Runs a compiled program on many records in parallel. All runs share the
+// address space of the calling process and compiled programs do not check
+// the bounds of their tape. Each worker's tape is therefore surrounded by
+// inaccessible guard pages: a record moving off the tape crashes the whole
+// process instead of silently corrupting memory the other workers use. Moves
+// far beyond the guard pages are not caught, so only run trusted programs.
+class Parallel_Runner {
+  std::shared_ptr<const Compiled_Program> _program;
+  unsigned _jobs;
+
+public:
+  // Run program with the given number of worker threads; 0 means one per
+  // hardware thread.
+  Parallel_Runner(std::shared_ptr<const Compiled_Program> program,
+                  unsigned jobs = 0);
+
+  // Run the program once per record, each run on a fresh tape with the
+  // record as input. outputs[i] is set to the output of the run for
+  // records[i]. The tapes are mapped before any record is run; if that
+  // fails, TAPE_UNAVAILABLE is returned and nothing is run.
+  Run_Status run(const std::vector<std::string> &records,
+                 std::vector<std::string> &outputs) const;
+
+  // Read records separated by delimiter from input, run the program on each
+  // of them and write the outputs, each followed by delimiter, to output in
+  // the order of the records. Records are run by a pool of worker threads
+  // while the calling thread keeps reading; each output is written as soon
+  // as all earlier ones are. Only a bounded number of records is held in
+  // memory, however large input is. Fails like the above before reading
+  // any input.
+  Run_Status run(std::istream &input, std::ostream &output,
+                 const char delimiter) const;
+
+  inline unsigned jobs() const { return _jobs; }
+
+  virtual ~Parallel_Runner() = default;
+};
+
+} // namespace bfllvm
+
+#endif
@@ -0,0 +1,20 @@
+/*
+bfllvm
+(C) Andreas Gaiser (doraeneko@github.com), 2024
+Size of the tape of bf programs; kept free of LLVM headers, so that code
+embedding bfllvm (see jit.h) can allocate tapes.
+*/
+
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <cstdint>
+
+namespace bfllvm {
+
+// number of cells of the tape a bf program works on
+const std::uint32_t BF_ARRAY_SIZE = 60000;
+
+} // namespace bfllvm
+
+#endif
@@ -0,0 +1,3 @@
+copies its input to its output
+(end of input reads as 255)
+,+[-.,+]
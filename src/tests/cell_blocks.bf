@@ -0,0 +1,9 @@
+multiply add loop: cells 1 and 2 get 8 times 8
+++++++++[->++++++++>++++++++<<]>+.>++.
+wide multiply add loop: cells 4 to 23 get 4 times 16
+>++++[->++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++>++++++++++++++++<<<<<<<<<<<<<<<<<<<<]
+wide block update: add 1 to 20 to cells 4 to 23 and print them
+>+>++>+++>++++>+++++>++++++>+++++++>++++++++>+++++++++>++++++++++>+++++++++++>++++++++++++>+++++++++++++>++++++++++++++>+++++++++++++++>++++++++++++++++>+++++++++++++++++>++++++++++++++++++>+++++++++++++++++++>++++++++++++++++++++
+<<<<<<<<<<<<<<<<<<<.>.>.>.>.>.>.>.>.>.>.>.>.>.>.>.>.>.>.>.
+wide clear and newline
+[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]<[-]++++++++++.
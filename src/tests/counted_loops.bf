@@ -0,0 +1,9 @@
+nested counted loops: cell 2 gets 4 times 4 times 4 plus 1
+++++[>++++[>++++<-]<-]>>+.
+counted loop printing cell 2 six times
+<<++++++[>>.+<<-]
+control cell counting upwards from 251: five iterations
+>>>-----[>+<+]>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
+control cell decremented by three from 9: three iterations
+>+++++++++[>+<---]>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
+[-]++++++++++.
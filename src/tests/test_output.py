@@ -4,18 +4,63 @@
 # using pytest.
 ########################################
 import os
+import re
+import select
 import subprocess
 import pytest
 import shutil
 import pathlib
 
 
+TESTS_DIR = pathlib.Path(os.path.dirname(__file__))
+
+
+@pytest.fixture
+def run_bfllvm(tmp_path):
+    """Copy the built executable into the temporary directory and return a function running it there."""
+    executable_src_path = TESTS_DIR / "../../build/bfllvm"  # Modify this path as needed
+    executable_temp_path = tmp_path / "bfllvm"
+    try:
+        shutil.copy(executable_src_path, executable_temp_path)
+    except FileNotFoundError:
+        print("Could not find bfllvm executable in build dir. Have you built it?")
+        assert False
+
+    def run(args, input_text=""):
+        return subprocess.run(
+            [executable_temp_path] + args,
+            input=input_text,
+            cwd=tmp_path,
+            capture_output=True,
+            text=True,
+        )
+
+    run.path = executable_temp_path
+    return run
+
+
+@pytest.fixture
+def run_tool(tmp_path):
+    """Return a function running an LLVM tool (lli, llvm-dis) in the temporary directory."""
+
+    def run(args):
+        try:
+            return subprocess.run(args, cwd=tmp_path, capture_output=True, text=True)
+        except FileNotFoundError:
+            print(f"Could not find {args[0]} tool.")
+            assert False
+
+    return run
+
+
 @pytest.mark.parametrize(
     "test_file, intermediate, expected_return_code, expected_output",
     [
         ("hello_world.bf", "intermediate.bf", 0, "Hello, World!"),
         ("invalid.bf", "intermediate.bf", 1, None),
         ("output_h.bf", "intermediate.bf", 0, "H\n"),
+        ("cell_blocks.bf", "intermediate.bf", 0, "ABABCDEFGHIJKLMNOPQRST\n"),
+        ("counted_loops.bf", "intermediate.bf", 0, "AABCDEFAA\n"),
     ],
 )
 def test_executable_output_in_temp_dir(
@@ -68,3 +113,175 @@ def test_executable_output_in_temp_dir(
     assert (
         result.stdout == expected_output
     ), "Executable output does not match the expected output."
+
+
+@pytest.mark.parametrize(
+    "program, expected_pattern, unexpected_pattern",
+    [
+        # the 20-cell block update is lowered to at least SSE-wide vectors
+        (
+            (TESTS_DIR / "cell_blocks.bf").read_text(),
+            r"<(16|32|64) x i8>",
+            r"<[248] x i8>",
+        ),
+        # runs are folded across streamed regions: the clear and both
+        # increments of cell 0 become a single store of 65
+        ("+" * 5 + "[-]" + "+" * 65 + ".", r"store i8 65", r"add i8"),
+        # loops with a known trip count become counted loops
+        (
+            (TESTS_DIR / "counted_loops.bf").read_text(),
+            r"(?s)%counter = phi i32.*\ncounted_latch\d*:",
+            r"(?m)^condition\d*:",
+        ),
+        # a body writing the control cell keeps the loop a plain while loop
+        (",[,-].", r"(?m)^condition\d*:", r"counted_latch|%counter"),
+    ],
+)
+def test_generated_code(run_bfllvm, run_tool, program, expected_pattern, unexpected_pattern):
+    """Test the shape of the generated code using llvm-dis."""
+    result = run_bfllvm(["-o", "intermediate.bc"], program)
+    assert result.returncode == 0, f"Executable failed with exit code {result.returncode}"
+
+    result = run_tool(["llvm-dis", "intermediate.bc", "-o", "-"])
+    assert result.returncode == 0, "Could not disassemble intermediate.bc"
+    assert re.search(expected_pattern, result.stdout), "Expected code not generated."
+    assert not re.search(unexpected_pattern, result.stdout), "Unexpected code generated."
+
+
+@pytest.mark.parametrize(
+    "test_file, options, input_text, expected_return_code, expected_output",
+    [
+        ("hello_world.bf", [], "", 0, "Hello, World!"),
+        ("invalid.bf", [], "", 1, None),
+        ("cell_blocks.bf", [], "", 0, "ABABCDEFGHIJKLMNOPQRST\n"),
+        ("counted_loops.bf", [], "", 0, "AABCDEFAA\n"),
+        ("cat.bf", [], "abc\nxyz", 0, "abc\nxyz"),
+        ("cat.bf", ["--records"], "abc\nxyz\n", 0, "abc\nxyz\n"),
+        ("cat.bf", ["--records", "--delimiter", ","], "ab,cd,ef", 0, "ab,cd,ef,"),
+        (
+            "cat.bf",
+            ["--records", "--jobs", "4"],
+            "".join(f"record {i}\n" for i in range(5000)),
+            0,
+            "".join(f"record {i}\n" for i in range(5000)),
+        ),
+        (
+            "hello_world.bf",
+            ["--records", "--jobs", "2"],
+            "1\n2\n3\n",
+            0,
+            "Hello, World!\n" * 3,
+        ),
+    ],
+)
+def test_jit_run_output(
+    run_bfllvm, test_file, options, input_text, expected_return_code, expected_output
+):
+    """Test programs JIT-compiled and run in-process via --run, optionally once per input record."""
+    result = run_bfllvm(["--run", str(TESTS_DIR / test_file)] + options, input_text)
+    assert (
+        result.returncode == expected_return_code
+    ), f"Executable failed with exit code {result.returncode}"
+    if expected_return_code != 0:
+        return
+    assert (
+        result.stdout == expected_output
+    ), "Executable output does not match the expected output."
+
+
+@pytest.mark.parametrize(
+    "options",
+    [
+        ["--run", "cat.bf", "--records", "--jobs", "abc"],
+        ["--run", "cat.bf", "--records", "--jobs", "-1"],
+        ["--run", "cat.bf", "--records", "--jobs", "999999999"],
+        ["--records"],
+        ["-o", "intermediate.bc", "--records"],
+        ["--run", "cat.bf", "--jobs", "2"],
+    ],
+)
+def test_invalid_options(run_bfllvm, options):
+    """Test that invalid or inapplicable options are rejected with the usage text."""
+    options = [str(TESTS_DIR / option) if option.endswith(".bf") else option for option in options]
+    result = run_bfllvm(options, "abc\n")
+    assert "Usage example" in result.stdout, "Usage text not shown."
+    assert "abc" not in result.stdout, "Program was run."
+
+
+@pytest.mark.parametrize(
+    "options, chunks",
+    [
+        ([], [b"a", b"b"]),
+        (["--records", "--jobs", "2"], [b"ab\n", b"cd\n"]),
+    ],
+)
+def test_jit_run_is_interactive(run_bfllvm, tmp_path, options, chunks):
+    """Test that --run answers each chunk of input before the input is complete."""
+    process = subprocess.Popen(
+        [run_bfllvm.path, "--run", str(TESTS_DIR / "cat.bf")] + options,
+        cwd=tmp_path,
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+    )
+    try:
+        for chunk in chunks:
+            process.stdin.write(chunk)
+            process.stdin.flush()
+            ready, _, _ = select.select([process.stdout], [], [], 10)
+            assert ready, "No output before the end of the input."
+            assert process.stdout.read(len(chunk)) == chunk
+    finally:
+        process.stdin.close()
+        process.wait(timeout=10)
+
+
+@pytest.mark.parametrize(
+    "options, program, expected_output",
+    [
+        # 10065 = 39 * 256 + 81, i.e. 'Q'; the run is longer than one streamed region
+        ([], "+" * 10065 + "." + "[-]" + "+" * 10 + ".", "Q\n"),
+        (["-g"], "+" * 10065 + "." + "[-]" + "+" * 10 + ".", "Q\n"),
+    ],
+)
+def test_streamed_long_program(run_bfllvm, run_tool, options, program, expected_output):
+    """Test a program with more top-level commands than fit in one streamed region."""
+    result = run_bfllvm(options + ["-o", "intermediate.bc"], program)
+    assert result.returncode == 0, f"Executable failed with exit code {result.returncode}"
+
+    result = run_tool(["lli", "intermediate.bc"])
+    assert result.stdout == expected_output, "Executable output does not match the expected output."
+
+
+@pytest.mark.parametrize(
+    "test_file, expected_output, expected_location",
+    [
+        # the run of '>' and '+' starting the program
+        ("hello_world.bf", "Hello, World!", "!DILocation(line: 1, column: 1,"),
+        # the multiply add loop starting in column 9 of line 2
+        ("cell_blocks.bf", "ABABCDEFGHIJKLMNOPQRST\n", "!DILocation(line: 2, column: 9,"),
+    ],
+)
+def test_debug_info_output(run_bfllvm, run_tool, test_file, expected_output, expected_location):
+    """Test that programs compiled with debug information (-g) run correctly and map code to the source."""
+    result = run_bfllvm(["-g", "-o", "intermediate.bc", str(TESTS_DIR / test_file)])
+    assert result.returncode == 0, f"Executable failed with exit code {result.returncode}"
+
+    result = run_tool(["lli", "intermediate.bc"])
+    assert (
+        result.stdout == expected_output
+    ), "Executable output does not match the expected output."
+
+    result = run_tool(["llvm-dis", "intermediate.bc", "-o", "-"])
+    assert result.returncode == 0, "Could not disassemble intermediate.bc"
+    assert f'!DIFile(filename: "{test_file}"' in result.stdout, "No DIFile for the source."
+    assert 'distinct !DISubprogram(name: "main"' in result.stdout, "No DISubprogram for main."
+    assert expected_location in result.stdout, "Source location missing."
+
+
+def test_debug_info_from_stdin(run_bfllvm, run_tool):
+    """Test that a program read from stdin is described as <stdin>, not as a file in the cwd."""
+    result = run_bfllvm(["-g", "-o", "intermediate.bc"], "+++.")
+    assert result.returncode == 0, f"Executable failed with exit code {result.returncode}"
+
+    result = run_tool(["llvm-dis", "intermediate.bc", "-o", "-"])
+    assert '!DIFile(filename: "<stdin>", directory: "")' in result.stdout